@@ -0,0 +1,61 @@
+#include "simple-multithreader.h"
+#include <assert.h>
+
+/*
+ * Batch of independent matrix multiplications. The outer parallel_for runs
+ * over matrices and each body calls parallel_for again over the rows of
+ * its matrix. The nested calls share the outer thread budget, so the peak
+ * number of live workers stays at numThread instead of numThread^2.
+ */
+
+int main(int argc, char** argv) {
+  // intialize problem size
+  int numThread = argc>1 ? atoi(argv[1]) : 2;
+  int batch = argc>2 ? atoi(argv[2]) : 16;
+  int size = argc>3 ? atoi(argv[3]) : 256;
+  // allocate one flat matrix per batch entry
+  int** A = new int*[batch];
+  int** B = new int*[batch];
+  int** C = new int*[batch];
+  parallel_for(0, batch, [=](int b) {
+    A[b] = new int[size * size];
+    B[b] = new int[size * size];
+    C[b] = new int[size * size];
+    std::fill(A[b], A[b]+size*size, 1);
+    std::fill(B[b], B[b]+size*size, 1);
+    std::fill(C[b], C[b]+size*size, 0);
+  }, numThread);
+  // outer loop over matrices, inner loop over rows
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  parallel_for(0, batch, [=](int b) {
+    int* a = A[b];
+    int* bm = B[b];
+    int* c = C[b];
+    parallel_for(0, size, [=](int i) {
+      for(int k=0; k<size; k++) {
+        int aik = a[i*size + k];
+        for(int j=0; j<size; j++) c[i*size + j] += aik * bm[k*size + j];
+      }
+    }, numThread);
+  }, numThread);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double wall_ms = (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+  // verify the result matrices
+  for(int b=0; b<batch; b++) for(int i=0; i<size*size; i++) assert(C[b][i] == size);
+  assert(pk_thr <= numThread);
+  printf("Test Success. \n");
+  printf("\nNested batch of %d %dx%d matrices: %f ms wall\n", batch, size, size, wall_ms);
+  printf("Peak active worker threads: %d (limit %d, unbounded nesting would use %d)\n",
+         pk_thr, numThread, numThread + numThread * numThread);
+  // cleanup memory
+  parallel_for(0, batch, [=](int b) {
+    delete [] A[b];
+    delete [] B[b];
+    delete [] C[b];
+  }, numThread);
+  delete[] A;
+  delete[] B;
+  delete[] C;
+  return 0;
+}
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <time.h>
 #include <cstring>
+#include <vector>
+#include <memory>
 
 using namespace std;
 
@@ -14,6 +16,45 @@ int user_main(int argc, char **argv);
 int in_c = 1;
 double tot_ex_t = 0;
 
+/*
+ * Thread budget shared by nested parallel_for calls. The outermost call
+ * sets the limit to its num_threads; a call made from inside a worker only
+ * spawns threads for slots that are currently free and runs the rest of
+ * its range inline. A slot is only given back once its thread has been
+ * joined, so the number of live worker pthreads never exceeds max_thr.
+ */
+pthread_mutex_t pf_lock = PTHREAD_MUTEX_INITIALIZER;
+int max_thr = 0;
+int act_thr = 0;
+int pk_thr = 0;
+thread_local int in_worker = 0;
+
+// returns how many new threads the caller may create for a range of rng
+int acquire_thr(int num_threads, int rng) {
+    // never reserve more slots than there are iterations to hand out
+    int want = min(num_threads, max(rng, 1));
+    pthread_mutex_lock(&pf_lock);
+    int n;
+    if (!in_worker) {
+        max_thr = num_threads;
+        n = want;
+    } else {
+        // the calling worker already holds a slot and runs one chunk itself
+        n = min(want - 1, max_thr - act_thr);
+        if (n < 0) n = 0;
+    }
+    act_thr += n;
+    if (act_thr > pk_thr) pk_thr = act_thr;
+    pthread_mutex_unlock(&pf_lock);
+    return n;
+}
+
+void release_thr() {
+    pthread_mutex_lock(&pf_lock);
+    act_thr--;
+    pthread_mutex_unlock(&pf_lock);
+}
+
 void demonstration(std::function<void()> &&lambda_f) {
     lambda_f();
 }
@@ -54,12 +95,14 @@ void n_loop(int o_strt, int o_end, int i_strt, int i_end, function<void(int, int
 
 void* thread_f_s(void* args) {
     threads_args_s* arg_ptr = (threads_args_s*)args;
+    in_worker = 1;
     loop(arg_ptr->strt, arg_ptr->end, move(arg_ptr->lambda));
     pthread_exit(nullptr);
 }
 
 void* thread_f_nest(void* args) {
     threads_args_nest* arg_ptr = (threads_args_nest*)args;
+    in_worker = 1;
     n_loop(arg_ptr->o_strt, arg_ptr->o_end, arg_ptr->i_strt, arg_ptr->i_end, move(arg_ptr->lambda));
     pthread_exit(nullptr);
 }
@@ -73,71 +116,229 @@ int calc_chunk_ofl(int base, int idx, int chunk_sz, int ofl) {
 }
 
 void parallel_for(int strt, int end, function<void(int)>&& lambda, int num_threads) {
-    pthread_t threads[num_threads];
-    threads_args_s thread_args[num_threads];
-
+    int nested = in_worker;
     int rng = (end - strt);
-    int chunk_sz = rng / num_threads;
-    int ofl = rng % num_threads;
+    int n_spawn = acquire_thr(num_threads, rng);
+    int n_chunks = nested ? n_spawn + 1 : n_spawn;
+    pthread_t threads[n_chunks];
+    bool spawned[n_chunks];
+    threads_args_s thread_args[n_chunks];
+
+    int chunk_sz = rng / n_chunks;
+    int ofl = rng % n_chunks;
     clock_t strt_t = clock();
 
     int i = 0;
-    while (i < num_threads) {
+    while (i < n_chunks) {
         thread_args[i].strt = calc_chunk(strt, i, chunk_sz);
-        thread_args[i].end = (i == num_threads - 1) ? calc_chunk_ofl(strt, i + 1, chunk_sz, ofl) : calc_chunk(strt, i + 1, chunk_sz);
+        thread_args[i].end = (i == n_chunks - 1) ? calc_chunk_ofl(strt, i + 1, chunk_sz, ofl) : calc_chunk(strt, i + 1, chunk_sz);
         thread_args[i].lambda = lambda;
-        if (pthread_create(&threads[i], nullptr, thread_f_s, (void*)&thread_args[i]) != 0) {
-          ERROR_MSG("pthread_create failed"); 
+        spawned[i] = false;
+        if (i < n_spawn) {
+            if (pthread_create(&threads[i], nullptr, thread_f_s, (void*)&thread_args[i]) == 0) {
+                spawned[i] = true;
+            } else {
+                ERROR_MSG("pthread_create failed"); 
+            }
+        }
+        i++;
+    }
+
+    /*
+     * Run the remaining chunks on the calling thread: the last chunk of a
+     * nested call, and any chunk whose thread could not be created. These
+     * run as a worker so parallel_for calls inside them stay nested, and
+     * a failed thread's slot stays reserved until its chunk is done.
+     */
+    int was_worker = in_worker;
+    in_worker = 1;
+    i = 0;
+    while (i < n_chunks) {
+        if (!spawned[i]) {
+            loop(thread_args[i].strt, thread_args[i].end, move(thread_args[i].lambda));
+            if (i < n_spawn) release_thr();
         }
         i++;
     }
+    in_worker = was_worker;
 
     i = 0;
-    while (i < num_threads) {
-        if (pthread_join(threads[i], nullptr) != 0) { 
-          ERROR_MSG("pthread_join failed"); 
+    while (i < n_spawn) {
+        if (spawned[i]) {
+            if (pthread_join(threads[i], nullptr) != 0) { 
+              ERROR_MSG("pthread_join failed"); 
+            }
+            release_thr();
         }
         i++;
     }
 
+    // nested calls are already counted in the time of the enclosing call
+    if (nested) return;
     double elapsed_t = ((double)(clock() - strt_t)) * 1000.0 / CLOCKS_PER_SEC;
+    pthread_mutex_lock(&pf_lock);
     printf("\nExecution Time for parallel_for Call %d: %f ms\n", in_c++, elapsed_t);
     tot_ex_t += elapsed_t;
+    pthread_mutex_unlock(&pf_lock);
 }
 
 void parallel_for(int o_strt, int o_end, int i_strt, int i_end, function<void(int, int)>&& lambda, int num_threads) {
-    pthread_t threads[num_threads];
-    threads_args_nest thread_args[num_threads];
-
+    int nested = in_worker;
     int rng = o_end - o_strt;
-    int chunk_sz = rng / num_threads;
-    int ofl = rng % num_threads;
+    int n_spawn = acquire_thr(num_threads, rng);
+    int n_chunks = nested ? n_spawn + 1 : n_spawn;
+    pthread_t threads[n_chunks];
+    bool spawned[n_chunks];
+    threads_args_nest thread_args[n_chunks];
+
+    int chunk_sz = rng / n_chunks;
+    int ofl = rng % n_chunks;
     clock_t strt_t = clock();
 
     int i = 0;
-    while (i < num_threads) {
+    while (i < n_chunks) {
         thread_args[i].o_strt = calc_chunk(o_strt, i, chunk_sz);
-        thread_args[i].o_end = (i == num_threads - 1) ? calc_chunk_ofl(o_strt, i + 1, chunk_sz, ofl) : calc_chunk(o_strt, i + 1, chunk_sz);
+        thread_args[i].o_end = (i == n_chunks - 1) ? calc_chunk_ofl(o_strt, i + 1, chunk_sz, ofl) : calc_chunk(o_strt, i + 1, chunk_sz);
         thread_args[i].i_strt = i_strt;
         thread_args[i].i_end = i_end;
         thread_args[i].lambda = lambda;
-        if (pthread_create(&threads[i], nullptr, thread_f_nest, (void*)&thread_args[i]) != 0) { 
-          ERROR_MSG("pthread_create failed"); 
+        spawned[i] = false;
+        if (i < n_spawn) {
+            if (pthread_create(&threads[i], nullptr, thread_f_nest, (void*)&thread_args[i]) == 0) {
+                spawned[i] = true;
+            } else {
+                ERROR_MSG("pthread_create failed"); 
+            }
         }
         i++;
     }
 
+    int was_worker = in_worker;
+    in_worker = 1;
     i = 0;
-    while (i < num_threads) {
-        if (pthread_join(threads[i], nullptr) != 0) { ERROR_MSG("pthread_join failed"); }
+    while (i < n_chunks) {
+        if (!spawned[i]) {
+            threads_args_nest* arg = &thread_args[i];
+            n_loop(arg->o_strt, arg->o_end, arg->i_strt, arg->i_end, move(arg->lambda));
+            if (i < n_spawn) release_thr();
+        }
         i++;
     }
+    in_worker = was_worker;
 
+    i = 0;
+    while (i < n_spawn) {
+        if (spawned[i]) {
+            if (pthread_join(threads[i], nullptr) != 0) { ERROR_MSG("pthread_join failed"); }
+            release_thr();
+        }
+        i++;
+    }
+
+    if (nested) return;
     double elapsed_t = ((double)(clock() - strt_t)) * 1000.0 / CLOCKS_PER_SEC;
+    pthread_mutex_lock(&pf_lock);
     printf("\nExecution Time for parallel_for Call %d: %f ms\n", in_c++, elapsed_t);
     tot_ex_t += elapsed_t;
+    pthread_mutex_unlock(&pf_lock);
 }
 
+/*
+ * Lazy fused loop pipeline. Stages are only recorded when they are added;
+ * run() makes a single parallel_for over fixed-size blocks of the range
+ * and pushes each block through every stage in order, so data written by
+ * one stage is read by the next while it is still in cache instead of
+ * streaming the whole array through memory once per pass.
+ */
+class pipeline {
+public:
+    pipeline(int strt, int end, int blk_sz = 4096)
+        : strt(strt), end(end), blk_sz(blk_sz), n_blk(0) {
+        // an empty or reversed range has no blocks; a bad block size is
+        // reported and leaves the pipeline empty
+        if (blk_sz <= 0) {
+            ERROR_MSG("pipeline block size must be positive");
+            return;
+        }
+        long rng = (long)end - strt;
+        if (rng > 0) n_blk = (int)((rng + blk_sz - 1) / blk_sz);
+    }
+
+    // out[i] = f(i)
+    template <typename T, typename F>
+    pipeline& generate(T* out, F f) {
+        stages.push_back([=](int, int s, int e) {
+            for (int i = s; i < e; i++) out[i] = f(i);
+        });
+        return *this;
+    }
+
+    // out[i] = f(in[i])
+    template <typename T, typename U, typename F>
+    pipeline& map(const T* in, U* out, F f) {
+        stages.push_back([=](int, int s, int e) {
+            for (int i = s; i < e; i++) out[i] = f(in[i]);
+        });
+        return *this;
+    }
+
+    // out[i] = f(a[i], b[i])
+    template <typename T, typename U, typename V, typename F>
+    pipeline& zip(const T* a, const U* b, V* out, F f) {
+        stages.push_back([=](int, int s, int e) {
+            for (int i = s; i < e; i++) out[i] = f(a[i], b[i]);
+        });
+        return *this;
+    }
+
+    // f(i) for every index, same body as a parallel_for lambda
+    template <typename F>
+    pipeline& for_each(F f) {
+        stages.push_back([=](int, int s, int e) {
+            for (int i = s; i < e; i++) f(i);
+        });
+        return *this;
+    }
+
+    // *result = init combined with every in[i] by op, once run() returns.
+    // Each block is folded separately and the block results are folded
+    // into init afterwards, so op must be associative. R is the
+    // accumulator type, e.g. int data can be summed into a long.
+    template <typename T, typename R, typename F>
+    pipeline& reduce(const T* in, R init, F op, R* result) {
+        shared_ptr<vector<R>> part = make_shared<vector<R>>(n_blk);
+        stages.push_back([=](int b, int s, int e) {
+            R acc = in[s];
+            for (int i = s + 1; i < e; i++) acc = op(acc, in[i]);
+            (*part)[b] = acc;
+        });
+        finals.push_back([=]() {
+            R acc = init;
+            for (int b = 0; b < n_blk; b++) acc = op(acc, (*part)[b]);
+            *result = acc;
+        });
+        return *this;
+    }
+
+    void run(int num_threads) {
+        parallel_for(0, n_blk, [&](int b) {
+            // long arithmetic so a range ending near INT_MAX cannot overflow
+            long s = strt + (long)b * blk_sz;
+            long e = min(s + blk_sz, (long)end);
+            for (auto& stage : stages) stage(b, (int)s, (int)e);
+        }, num_threads);
+        for (auto& fin : finals) fin();
+    }
+
+private:
+    int strt;
+    int end;
+    int blk_sz;
+    int n_blk;
+    list<function<void(int, int, int)>> stages;
+    list<function<void()>> finals;
+};
+
 int main(int argc, char **argv) {
   // defineStructures();
   /* 
@@ -0,0 +1,200 @@
+#include "simple-multithreader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Out-of-core version of vector.cpp. A, B and C live in files and are
+ * memory-mapped one window at a time. While parallel_for works on the
+ * current window, the next window of A and B is already mapped and the
+ * kernel is asked (madvise WILLNEED) to start reading it in, so disk I/O
+ * overlaps with compute. C is written through a shared mapping and each
+ * finished window is handed to writeback with sync_file_range.
+ */
+
+double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const char* out_dir = ".";
+const char* f_names[] = { "vector_A.bin", "vector_B.bin", "vector_C.bin" };
+
+void rm_files() {
+  char path[4096];
+  for (int i = 0; i < 3; i++) {
+    snprintf(path, sizeof(path), "%s/%s", out_dir, f_names[i]);
+    unlink(path);
+  }
+}
+
+// report errno, remove the scratch files and quit
+void die(const char* msg) {
+  perror(msg);
+  rm_files();
+  exit(1);
+}
+
+int open_f(const char* name, int flags) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", out_dir, name);
+  int fd = open(path, flags, 0644);
+  if (fd < 0) die(path);
+  return fd;
+}
+
+// write 'size' ints of value 'val' so the input files are really on disk
+void fill_f(int fd, long size, int val, int buf_elems) {
+  int* buf = new int[buf_elems];
+  std::fill(buf, buf+buf_elems, val);
+  long done = 0;
+  while (done < size) {
+    long n = std::min((long)buf_elems, size - done);
+    if (write(fd, buf, n * sizeof(int)) != (ssize_t)(n * sizeof(int))) die("write");
+    done += n;
+  }
+  delete[] buf;
+}
+
+// flush and evict a file from the page cache so the next read hits the disk
+void drop_cache(int fd) {
+  fsync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+typedef struct {
+  int* a;
+  int* b;
+  int* c;
+  size_t len;
+} window_s;
+
+void map_win(window_s* w, int fa, int fb, int fc, long off, long n) {
+  w->len = n * sizeof(int);
+  off_t b_off = (off_t)off * sizeof(int);
+  w->a = (int*)mmap(nullptr, w->len, PROT_READ, MAP_SHARED, fa, b_off);
+  w->b = (int*)mmap(nullptr, w->len, PROT_READ, MAP_SHARED, fb, b_off);
+  w->c = (int*)mmap(nullptr, w->len, PROT_READ | PROT_WRITE, MAP_SHARED, fc, b_off);
+  if (w->a == MAP_FAILED || w->b == MAP_FAILED || w->c == MAP_FAILED) die("mmap");
+  // prefetch: start asynchronous readahead of the inputs
+  madvise(w->a, w->len, MADV_SEQUENTIAL);
+  madvise(w->b, w->len, MADV_SEQUENTIAL);
+  madvise(w->a, w->len, MADV_WILLNEED);
+  madvise(w->b, w->len, MADV_WILLNEED);
+}
+
+void unmap_win(window_s* w) {
+  munmap(w->a, w->len);
+  munmap(w->b, w->len);
+  munmap(w->c, w->len);
+}
+
+int main(int argc, char** argv) {
+  // intialize problem size
+  int numThread = argc>1 ? atoi(argv[1]) : 2;
+  long size = argc>2 ? atol(argv[2]) : 48000000;
+  int window = argc>3 ? atoi(argv[3]) : 4194304;
+  if (argc>4) out_dir = argv[4];
+  if (size <= 0 || window <= 0) {
+    printf("size and window must be positive\n");
+    return 1;
+  }
+  // windows must start on a page boundary
+  int page_elems = sysconf(_SC_PAGESIZE) / sizeof(int);
+  window = ((window + page_elems - 1) / page_elems) * page_elems;
+  long bytes = size * sizeof(int);
+
+  // create the input files and an output file of the same size
+  int fa = open_f(f_names[0], O_RDWR | O_CREAT | O_TRUNC);
+  int fb = open_f(f_names[1], O_RDWR | O_CREAT | O_TRUNC);
+  int fc = open_f(f_names[2], O_RDWR | O_CREAT | O_TRUNC);
+  fill_f(fa, size, 1, window);
+  fill_f(fb, size, 1, window);
+  if (ftruncate(fc, bytes) != 0) die("ftruncate");
+  drop_cache(fa);
+  drop_cache(fb);
+  drop_cache(fc);
+
+  // raw disk bandwidth: sequential read of A with large aligned buffers
+  void* io_buf;
+  int rc = posix_memalign(&io_buf, 4096, window * sizeof(int));
+  if (rc != 0) {
+    errno = rc;
+    die("posix_memalign");
+  }
+  double t0 = now_s();
+  off_t pos = 0;
+  ssize_t got;
+  while ((got = pread(fa, io_buf, window * sizeof(int), pos)) > 0) pos += got;
+  double disk_bw = bytes / (now_s() - t0) / 1e9;
+  drop_cache(fa);
+
+  // raw memory bandwidth: copy between two in-memory buffers
+  long mem_elems = std::min(size, 16L * 1024 * 1024);
+  int* src = new int[mem_elems];
+  int* dst = new int[mem_elems];
+  std::fill(src, src+mem_elems, 1);
+  std::fill(dst, dst+mem_elems, 0);
+  t0 = now_s();
+  for (int r = 0; r < 4; r++) memcpy(dst, src, mem_elems * sizeof(int));
+  double mem_bw = 2.0 * 4 * mem_elems * sizeof(int) / (now_s() - t0) / 1e9;
+  delete[] src;
+  delete[] dst;
+  free(io_buf);
+
+  // start the streaming addition, one window ahead of the compute
+  t0 = now_s();
+  window_s cur, nxt;
+  map_win(&cur, fa, fb, fc, 0, std::min((long)window, size));
+  for (long off = 0; off < size; off += window) {
+    int n = (int)std::min((long)window, size - off);
+    long nxt_off = off + window;
+    if (nxt_off < size) {
+      map_win(&nxt, fa, fb, fc, nxt_off, std::min((long)window, size - nxt_off));
+    }
+    int* A = cur.a;
+    int* B = cur.b;
+    int* C = cur.c;
+    parallel_for(0, n, [&](int i) {
+      C[i] = A[i] + B[i];
+    }, numThread);
+    unmap_win(&cur);
+    // start writeback of the finished output window and drop the
+    // consumed input window so the page cache does not fill up
+    off_t b_off = (off_t)off * sizeof(int);
+    sync_file_range(fc, b_off, (off_t)n * sizeof(int), SYNC_FILE_RANGE_WRITE);
+    posix_fadvise(fa, b_off, (off_t)n * sizeof(int), POSIX_FADV_DONTNEED);
+    posix_fadvise(fb, b_off, (off_t)n * sizeof(int), POSIX_FADV_DONTNEED);
+    if (nxt_off < size) cur = nxt;
+  }
+  fsync(fc);
+  double elapsed = now_s() - t0;
+  double stream_bw = 3.0 * bytes / elapsed / 1e9;
+
+  // verify the result file
+  int* C = (int*)mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fc, 0);
+  if (C == MAP_FAILED) die("mmap");
+  long bad = 0;
+  for(long i=0; i<size; i++) if (C[i] != 2) bad++;
+  munmap(C, bytes);
+  if (bad) {
+    printf("Test Failed: %ld wrong elements\n", bad);
+    rm_files();
+    exit(1);
+  }
+  printf("Test Success\n");
+
+  printf("\nStreamed %ld elements in %d-element windows: %f s\n", size, window, elapsed);
+  printf("Sustained streaming bandwidth : %f GB/s (A + B read, C written)\n", stream_bw);
+  printf("Raw disk read bandwidth       : %f GB/s\n", disk_bw);
+  printf("Raw memory copy bandwidth     : %f GB/s\n", mem_bw);
+
+  // cleanup files
+  close(fa);
+  close(fb);
+  close(fc);
+  rm_files();
+  return 0;
+}